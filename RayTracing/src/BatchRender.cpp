@@ -0,0 +1,301 @@
+#include "BatchRender.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace Utils {
+
+	/*	turns a towards b at a constant angular rate, both unit length - when they point in opposite
+		directions any rotation works, a turn around the up axis is what a turntable expects	*/
+	static glm::vec3 Slerp(const glm::vec3& a, const glm::vec3& b, float t) {
+		float cosAngle = glm::clamp(glm::dot(a, b), -1.0f, 1.0f);
+		if (cosAngle > 0.9995f) {
+			return glm::normalize(glm::mix(a, b, t));
+		}
+
+		glm::vec3 perpendicular = b - a * cosAngle;
+		if (glm::dot(perpendicular, perpendicular) < 1e-8f) {
+			perpendicular = glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), a);
+			if (glm::dot(perpendicular, perpendicular) < 1e-8f) {
+				perpendicular = glm::cross(glm::vec3(1.0f, 0.0f, 0.0f), a);
+			}
+		}
+		perpendicular = glm::normalize(perpendicular);
+
+		float angle = std::acos(cosAngle) * t;
+		return a * std::cos(angle) + perpendicular * std::sin(angle);
+	}
+
+	//	uniform catmull-rom segment between p1 and p2, it passes through every key instead of cutting between them
+	static glm::vec3 CatmullRom(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3, float t) {
+		float t2 = t * t;
+		float t3 = t2 * t;
+		return ((p1 * 2.0f) + (p2 - p0) * t
+			+ (p0 * 2.0f - p1 * 5.0f + p2 * 4.0f - p3) * t2
+			+ (p1 * 3.0f - p0 - p2 * 3.0f + p3) * t3) * 0.5f;
+	}
+
+	/*	returns the key at the start of the segment that holds the given time, t is how far
+		into that segment the time is - past either end the closest key is held with t = 0	*/
+	template<typename Keyframe>
+	static const Keyframe* FindSegment(const Keyframe* first, const Keyframe* last, float time, float& t) {
+		t = 0.0f;
+		if (time <= first->time) {
+			return first;
+		}
+
+		for (const Keyframe* key = first; key + 1 < last; key++) {
+			const Keyframe* next = key + 1;
+			if (time < next->time) {
+				t = (time - key->time) / (next->time - key->time);
+				return key;
+			}
+		}
+		return last - 1;
+	}
+
+}
+
+
+bool CameraPath::LoadFromFile(const std::string& filepath) {
+	std::ifstream file(filepath);
+	if (!file) {
+		std::cerr << "Could not open camera path " << filepath << "\n";
+		return false;
+	}
+
+	cameraKeys.clear();
+	sphereKeys.clear();
+
+	std::string line;
+	uint32_t lineNumber = 0;
+	while (std::getline(file, line)) {
+		lineNumber++;
+
+		std::istringstream stream(line);
+		std::string type;
+		if (!(stream >> type) || type[0] == '#') {
+			continue;
+		}
+
+		bool parsed = false;
+		if (type == "camera") {
+			CameraKeyframe& key = cameraKeys.emplace_back();
+			parsed = (bool)(stream >> key.time
+				>> key.position.x >> key.position.y >> key.position.z
+				>> key.direction.x >> key.direction.y >> key.direction.z);
+
+			if (parsed && glm::dot(key.direction, key.direction) < 1e-12f) {
+				std::cerr << filepath << ":" << lineNumber << ": camera direction can't be zero\n";
+				return false;
+			}
+			if (parsed) {
+				key.direction = glm::normalize(key.direction);
+			}
+		}
+		else if (type == "sphere") {
+			SphereKeyframe& key = sphereKeys.emplace_back();
+			parsed = (bool)(stream >> key.time >> key.sphereIndex
+				>> key.position.x >> key.position.y >> key.position.z >> key.radius);
+		}
+
+		if (!parsed) {
+			std::cerr << filepath << ":" << lineNumber << ": could not parse keyframe\n";
+			return false;
+		}
+	}
+
+	//	keys of one sphere are next to each other, so Apply can interpolate every sphere in one pass
+	std::stable_sort(cameraKeys.begin(), cameraKeys.end(),
+		[](const CameraKeyframe& a, const CameraKeyframe& b) { return a.time < b.time; });
+	std::stable_sort(sphereKeys.begin(), sphereKeys.end(),
+		[](const SphereKeyframe& a, const SphereKeyframe& b) {
+			return a.sphereIndex != b.sphereIndex ? a.sphereIndex < b.sphereIndex : a.time < b.time;
+		});
+
+	return true;
+}
+
+
+float CameraPath::GetDuration() const {
+	float duration = 0.0f;
+	for (const CameraKeyframe& key : cameraKeys) {
+		duration = std::max(duration, key.time);
+	}
+	for (const SphereKeyframe& key : sphereKeys) {
+		duration = std::max(duration, key.time);
+	}
+	return duration;
+}
+
+
+void CameraPath::Apply(float time, Camera& camera, Scene& scene) const {
+	if (!cameraKeys.empty()) {
+		float t;
+		const CameraKeyframe* first = cameraKeys.data();
+		const CameraKeyframe* last = first + cameraKeys.size();
+		const CameraKeyframe* key = Utils::FindSegment(first, last, time, t);
+		const CameraKeyframe* next = t > 0.0f ? key + 1 : key;
+
+		//	the keys outside of the path are repeated at both ends
+		const CameraKeyframe* previous = key > first ? key - 1 : key;
+		const CameraKeyframe* afterNext = next + 1 < last ? next + 1 : next;
+
+		camera.SetView(Utils::CatmullRom(previous->position, key->position, next->position, afterNext->position, t),
+			Utils::Slerp(key->direction, next->direction, t));
+	}
+
+	//	the spheres are moved in place, nothing about the scene gets rebuilt between frames
+	size_t first = 0;
+	while (first < sphereKeys.size()) {
+		int sphereIndex = sphereKeys[first].sphereIndex;
+		size_t last = first;
+		while (last < sphereKeys.size() && sphereKeys[last].sphereIndex == sphereIndex) {
+			last++;
+		}
+
+		if (sphereIndex >= 0 && sphereIndex < (int)scene.objects.size()) {
+			float t;
+			const SphereKeyframe* key = Utils::FindSegment(sphereKeys.data() + first, sphereKeys.data() + last, time, t);
+			const SphereKeyframe* next = t > 0.0f ? key + 1 : key;
+
+			Sphere& sphere = scene.objects[sphereIndex];
+			sphere.position = glm::mix(key->position, next->position, t);
+			sphere.radius = glm::mix(key->radius, next->radius, t);
+		}
+
+		first = last;
+	}
+}
+
+
+void BatchRender::Start(const CameraPath& path, const Settings& settings, Renderer& renderer, const Camera& camera, const Scene& scene) {
+	this->path = path;
+	this->settings = settings;
+	this->settings.frameCount = std::max(this->settings.frameCount, 1u);
+	this->settings.samplesPerFrame = std::max(this->settings.samplesPerFrame, 1u);
+	this->settings.width = std::max(this->settings.width, 1u);
+	this->settings.height = std::max(this->settings.height, 1u);
+
+	savedSpheres = scene.objects;
+	savedCameraPosition = camera.GetPosition();
+	savedCameraDirection = camera.GetDirection();
+	savedAccumulate = renderer.GetSettings().accumulate;
+	savedSamplesPerPixel = renderer.GetSettings().samplesPerPixel;
+
+	currentFrame = 0;
+	frameSamples = 0;
+	running = true;
+}
+
+
+void BatchRender::Step(Renderer& renderer, Camera& camera, Scene& scene) {
+	if (!running) {
+		return;
+	}
+
+	//	the size is fixed for the whole sequence, the app doesn't resize while a batch runs
+	renderer.OnResize(settings.width, settings.height);
+	camera.OnResize(settings.width, settings.height);
+
+	if (frameSamples == 0) {
+		float time = 0.0f;
+		if (settings.frameCount > 1) {
+			time = path.GetDuration() * (float)currentFrame / (float)(settings.frameCount - 1);
+		}
+		path.Apply(time, camera, scene);
+
+		renderer.GetSettings().accumulate = true;
+		renderer.ResetFrameIndex();
+	}
+
+	/*	every frame of the sequence gets exactly samplesPerFrame samples - as many of them as possible go
+		into one Render call, so the resolve and the upload are paid once per call instead of per sample,
+		the last call only traces what is left of the budget	*/
+	uint32_t samples = std::min(settings.samplesPerFrame - frameSamples, MaxSamplesPerCall);
+	renderer.GetSettings().samplesPerPixel = (int)samples;
+
+	renderer.Render(scene, camera);
+	frameSamples += samples;
+	if (frameSamples < settings.samplesPerFrame) {
+		return;
+	}
+	frameSamples = 0;
+
+	//	the previous frame had all the Render calls of this one to get written, so this rarely waits
+	WaitForPendingWrite();
+
+	uint32_t width = renderer.GetFinalImage()->GetWidth();
+	uint32_t height = renderer.GetFinalImage()->GetHeight();
+	std::vector<uint32_t> pixels(renderer.GetImageData(), renderer.GetImageData() + (size_t)width * height);
+
+	char frameNumber[16];
+	snprintf(frameNumber, sizeof(frameNumber), "%04u", currentFrame);
+	pendingFilepath = settings.outputPrefix + frameNumber + ".ppm";
+
+	/*	the task owns everything it reads, nothing of this object - when the app closes in the middle of a
+		batch, the members declared after the future are gone before its destructor waits for the task	*/
+	pendingWrite = std::async(std::launch::async, [filepath = pendingFilepath, pixels = std::move(pixels), width, height]() {
+		return WritePPM(filepath, pixels.data(), width, height);
+	});
+
+	currentFrame++;
+	if (currentFrame == settings.frameCount) {
+		Finish(renderer, camera, scene);
+	}
+}
+
+
+void BatchRender::Cancel(Renderer& renderer, Camera& camera, Scene& scene) {
+	if (running) {
+		Finish(renderer, camera, scene);
+	}
+}
+
+
+void BatchRender::Finish(Renderer& renderer, Camera& camera, Scene& scene) {
+	WaitForPendingWrite();
+
+	scene.objects = savedSpheres;
+	camera.SetView(savedCameraPosition, savedCameraDirection);
+	renderer.GetSettings().accumulate = savedAccumulate;
+	renderer.GetSettings().samplesPerPixel = savedSamplesPerPixel;
+	renderer.ResetFrameIndex();
+
+	running = false;
+}
+
+
+void BatchRender::WaitForPendingWrite() {
+	if (pendingWrite.valid() && !pendingWrite.get()) {
+		std::cerr << "Could not write frame " << pendingFilepath << "\n";
+	}
+}
+
+
+bool BatchRender::WritePPM(const std::string& filepath, const uint32_t* pixels, uint32_t width, uint32_t height) {
+	std::ofstream file(filepath, std::ios::binary);
+	if (!file) {
+		return false;
+	}
+
+	file << "P6\n" << width << " " << height << "\n255\n";
+
+	//	row 0 of the image is at the bottom of the viewport, ppm starts at the top
+	std::vector<uint8_t> row(width * 3);
+	for (uint32_t y = height; y-- > 0;) {
+		for (uint32_t x = 0; x < width; x++) {
+			uint32_t pixel = pixels[x + y * width];
+			row[x * 3 + 0] = (uint8_t)(pixel);
+			row[x * 3 + 1] = (uint8_t)(pixel >> 8);
+			row[x * 3 + 2] = (uint8_t)(pixel >> 16);
+		}
+		file.write((const char*)row.data(), row.size());
+	}
+
+	return (bool)file;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "Camera.h"
+#include "Renderer.h"
+#include "Scene.h"
+
+struct CameraKeyframe {
+	float time = 0.0f;
+	glm::vec3 position{ 0.0f };
+	glm::vec3 direction{ 0.0f, 0.0f, -1.0f };
+};
+
+struct SphereKeyframe {
+	float time = 0.0f;
+	int sphereIndex = 0;
+	glm::vec3 position{ 0.0f };
+	float radius = 0.5f;
+};
+
+/*	keyframes for a turntable or a flythrough - camera positions follow a catmull-rom spline through the
+	keys, camera directions turn at a constant rate between them (slerp), sphere positions and radii are
+	interpolated linearly, so an orbiting sphere needs enough keys not to cut the corners -
+	a text file holds one keyframe per line, lines starting with # are skipped:
+		camera <time> <position x y z> <direction x y z>
+		sphere <time> <sphere index> <position x y z> <radius>	*/
+struct CameraPath {
+	std::vector<CameraKeyframe> cameraKeys;
+	std::vector<SphereKeyframe> sphereKeys;
+
+	bool LoadFromFile(const std::string& filepath);
+	float GetDuration() const;
+
+	//	moves the camera and the animated spheres to where they are at the given time
+	void Apply(float time, Camera& camera, Scene& scene) const;
+};
+
+/*	renders a camera path into an image sequence, one frame of the sequence per Step, so the
+	app keeps drawing in between - while frame k+1 is being traced, frame k gets written to disk
+	on another thread, so the render threads never wait for the file to be written	*/
+class BatchRender
+{
+public:
+	struct Settings {
+		uint32_t frameCount = 60;
+		uint32_t samplesPerFrame = 64;	//	fixed sample budget, every frame gets exactly this many samples per pixel
+		std::string outputPrefix = "frame_";	//	frames are written as <prefix>0000.ppm, <prefix>0001.ppm, ...
+		//	every frame of the sequence is rendered at this size, whatever the viewport does meanwhile
+		uint32_t width = 1280;
+		uint32_t height = 720;
+	};
+public:
+	/*	the camera, the spheres and the renderer settings are put back once the batch is finished -
+		Step makes a single Render call, so the app keeps responding while a frame accumulates,
+		and the frame is written out once it got all of its samples	*/
+	void Start(const CameraPath& path, const Settings& settings, Renderer& renderer, const Camera& camera, const Scene& scene);
+	void Step(Renderer& renderer, Camera& camera, Scene& scene);
+	void Cancel(Renderer& renderer, Camera& camera, Scene& scene);
+
+	bool IsRunning() const { return running; }
+	uint32_t GetCurrentFrame() const { return currentFrame; }
+	uint32_t GetFrameCount() const { return settings.frameCount; }
+private:
+	void Finish(Renderer& renderer, Camera& camera, Scene& scene);
+	void WaitForPendingWrite();
+
+	//	more samples than this in one Render call would make the app stop responding for too long
+	static constexpr uint32_t MaxSamplesPerCall = 16;
+
+	static bool WritePPM(const std::string& filepath, const uint32_t* pixels, uint32_t width, uint32_t height);
+private:
+	CameraPath path;
+	Settings settings;
+	bool running = false;
+	uint32_t currentFrame = 0;
+	uint32_t frameSamples = 0;	//	samples per pixel the current frame already got
+
+	//	the frame that is being written while the next one renders, it gets a copy of the pixels, the renderer's buffer gets reused right away
+	std::future<bool> pendingWrite;
+	std::string pendingFilepath;	//	only for reporting a failed write
+
+	std::vector<Sphere> savedSpheres;
+	glm::vec3 savedCameraPosition{ 0.0f };
+	glm::vec3 savedCameraDirection{ 0.0f, 0.0f, -1.0f };
+	bool savedAccumulate = true;
+	int savedSamplesPerPixel = 1;
+};
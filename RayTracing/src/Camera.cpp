@@ -112,6 +112,15 @@ void Camera::OnResize(uint32_t width, uint32_t height)
 	RecalculateRayDirections();
 }
 
+void Camera::SetView(const glm::vec3& position, const glm::vec3& forwardDirection)
+{
+	m_Position = position;
+	m_ForwardDirection = glm::normalize(forwardDirection);
+
+	RecalculateView();
+	RecalculateRayDirections();
+}
+
 float Camera::GetRotationSpeed()
 {
 	return 0.3f;
@@ -138,17 +147,29 @@ void Camera::RecalculateView()
 void Camera::RecalculateRayDirections()
 {
 	m_RayDirections.resize(m_ViewportWidth * m_ViewportHeight);
+	m_RayDirectionsVersion++;
+
+	if (m_ViewportWidth == 0 || m_ViewportHeight == 0)
+		return;
+
+	m_PixelDirectionOrigin = CalculatePixelDirection(0.0f, 0.0f);
+	m_PixelDirectionX = CalculatePixelDirection(1.0f, 0.0f) - m_PixelDirectionOrigin;
+	m_PixelDirectionY = CalculatePixelDirection(0.0f, 1.0f) - m_PixelDirectionOrigin;
 
 	for (uint32_t y = 0; y < m_ViewportHeight; y++)
 	{
 		for (uint32_t x = 0; x < m_ViewportWidth; x++)
 		{
-			glm::vec2 coord = { (float)x / (float)m_ViewportWidth, (float)y / (float)m_ViewportHeight };
-			coord = coord * 2.0f - 1.0f; // -1 -> 1
-
-			glm::vec4 target = m_InverseProjection * glm::vec4(coord.x, coord.y, 1, 1);
-			glm::vec3 rayDirection = glm::vec3(m_InverseView * glm::vec4(glm::normalize(glm::vec3(target) / target.w), 0)); // world space
-			m_RayDirections[x + y * m_ViewportWidth] = rayDirection;
+			m_RayDirections[x + y * m_ViewportWidth] = CalculateRayDirection({ (float)x, (float)y });
 		}
 	}
 }
+
+glm::vec3 Camera::CalculatePixelDirection(float x, float y) const
+{
+	glm::vec2 coord = { x / (float)m_ViewportWidth, y / (float)m_ViewportHeight };
+	coord = coord * 2.0f - 1.0f; // -1 -> 1
+
+	glm::vec4 target = m_InverseProjection * glm::vec4(coord.x, coord.y, 1, 1);
+	return glm::vec3(m_InverseView * glm::vec4(glm::vec3(target) / target.w, 0)); // world space
+}
@@ -17,6 +17,10 @@ public:
 	bool OnUpdate(float ts);
 	void OnResize(uint32_t width, uint32_t height);
 
+	/*	places the camera without any input, used when the camera follows a path -
+		the cached ray directions are recalculated in place, no reallocation happens	*/
+	void SetView(const glm::vec3& position, const glm::vec3& forwardDirection);
+
 	const glm::mat4& GetProjection() const { return m_Projection; }
 	const glm::mat4& GetInverseProjection() const { return m_InverseProjection; }
 	const glm::mat4& GetView() const { return m_View; }
@@ -29,12 +33,23 @@ public:
 		have to be recalculated if the camera is moving, it will not be required
 		if the camera is standing still which speeds up the rendering process	*/
 	const std::vector<glm::vec3>& GetRayDirections() const { return m_RayDirections; }
+	//	changes every time the ray directions are recalculated, so copies of them know when they went stale
+	uint32_t GetRayDirectionsVersion() const { return m_RayDirectionsVersion; }
+
+	/*	world space direction through any point of the viewport, in pixels - (x, y) is the
+		same direction as the cached one for that pixel, fractions land inside the pixel -
+		cheap enough to be called for every sample, it's a couple of multiply-adds and a normalize	*/
+	glm::vec3 CalculateRayDirection(const glm::vec2& pixel) const
+	{
+		return glm::normalize(m_PixelDirectionOrigin + m_PixelDirectionX * pixel.x + m_PixelDirectionY * pixel.y);
+	}
 
 	float GetRotationSpeed();
 private:
 	void RecalculateProjection();
 	void RecalculateView();
 	void RecalculateRayDirections();
+	glm::vec3 CalculatePixelDirection(float x, float y) const;	//	not normalized
 private:
 	glm::mat4 m_Projection{ 1.0f };
 	glm::mat4 m_View{ 1.0f };
@@ -50,6 +65,13 @@ private:
 
 	// Cached ray directions
 	std::vector<glm::vec3> m_RayDirections;
+	uint32_t m_RayDirectionsVersion = 0;
+
+	/*	before normalizing, the direction through a pixel changes linearly with its position, so
+		pixel (x, y) looks along origin + x * directionX + y * directionY, in world space	*/
+	glm::vec3 m_PixelDirectionOrigin{ 0.0f, 0.0f, -1.0f };
+	glm::vec3 m_PixelDirectionX{ 0.0f };
+	glm::vec3 m_PixelDirectionY{ 0.0f };
 
 	glm::vec2 m_LastMousePosition{ 0.0f, 0.0f };
 
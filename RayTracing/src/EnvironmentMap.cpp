@@ -0,0 +1,190 @@
+#include "EnvironmentMap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+//	the implementation is compiled into Walnut
+#include "stb_image.h"
+
+namespace Utils {
+
+	static constexpr float Pi = 3.14159265358979f;
+
+	static float Luminance(const glm::vec3& color) {
+		return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	}
+
+	//	latitude-longitude mapping, u = 0.5 looks down -z like the camera does by default
+	static glm::vec2 DirectionToUV(const glm::vec3& direction) {
+		float u = 0.5f + std::atan2(direction.x, -direction.z) / (2.0f * Pi);
+		float v = std::acos(glm::clamp(direction.y, -1.0f, 1.0f)) / Pi;
+		return { u, v };
+	}
+
+	/*	inverts a cdf with count + 1 entries - returns the picked entry and how far
+		into it u landed, which is uniform again and can be used as the position in the cell	*/
+	static uint32_t SampleCdf(const float* cdf, uint32_t count, float u, float& fraction) {
+		const float* upper = std::upper_bound(cdf, cdf + count + 1, u);
+		uint32_t index = (uint32_t)glm::clamp((int)(upper - cdf) - 1, 0, (int)count - 1);
+
+		float width = cdf[index + 1] - cdf[index];
+		fraction = width > 0.0f ? glm::clamp((u - cdf[index]) / width, 0.0f, 1.0f) : 0.5f;
+		return index;
+	}
+
+}
+
+
+const glm::vec3& EnvironmentMap::Image::Texel(uint32_t x, uint32_t y) const {
+	uint32_t tile = (y / TileSize) * tilesPerRow + x / TileSize;
+	return texels[tile * TileSize * TileSize + (y % TileSize) * TileSize + x % TileSize];
+}
+
+
+glm::vec3& EnvironmentMap::Image::Texel(uint32_t x, uint32_t y) {
+	uint32_t tile = (y / TileSize) * tilesPerRow + x / TileSize;
+	return texels[tile * TileSize * TileSize + (y % TileSize) * TileSize + x % TileSize];
+}
+
+
+EnvironmentMap::Image EnvironmentMap::CreateImage(uint32_t width, uint32_t height) {
+	Image image;
+	image.width = width;
+	image.height = height;
+	image.tilesPerRow = (width + TileSize - 1) / TileSize;
+
+	uint32_t tilesPerColumn = (height + TileSize - 1) / TileSize;
+	image.texels.resize((size_t)image.tilesPerRow * tilesPerColumn * TileSize * TileSize);
+	return image;
+}
+
+
+bool EnvironmentMap::Load(const std::string& filepath) {
+	int width, height, channels;
+	float* data = stbi_loadf(filepath.c_str(), &width, &height, &channels, 3);
+	if (!data) {
+		std::cerr << "Could not load environment map " << filepath << ": " << stbi_failure_reason() << "\n";
+		return false;
+	}
+
+	this->filepath = filepath;
+
+	image = CreateImage((uint32_t)width, (uint32_t)height);
+	for (uint32_t y = 0; y < image.height; y++) {
+		for (uint32_t x = 0; x < image.width; x++) {
+			const float* texel = data + ((size_t)x + (size_t)y * image.width) * 3;
+			image.Texel(x, y) = glm::vec3(texel[0], texel[1], texel[2]);
+		}
+	}
+	stbi_image_free(data);
+
+	BuildDistribution();
+	return true;
+}
+
+
+void EnvironmentMap::BuildDistribution() {
+	/*	cells bigger than a texel keep the tables small, sampling a cell and then a uniform
+		spot inside of it is still unbiased, the pdf is exact for the cells - the cells keep
+		the aspect of the image, and together they cover every texel, also with odd sizes	*/
+	distributionWidth = std::min(image.width, MaxDistributionWidth);
+	distributionHeight = std::clamp(image.height * distributionWidth / image.width, 1u, image.height);
+	cellFunction.resize((size_t)distributionWidth * distributionHeight);
+	conditionalCdf.resize((size_t)(distributionWidth + 1) * distributionHeight);
+	marginalCdf.resize(distributionHeight + 1);
+
+	marginalCdf[0] = 0.0f;
+	for (uint32_t y = 0; y < distributionHeight; y++) {
+		//	rows near the poles cover less of the sphere than the ones around the equator
+		float sinTheta = std::sin(Utils::Pi * ((float)y + 0.5f) / (float)distributionHeight);
+
+		uint32_t texelY0 = y * image.height / distributionHeight;
+		uint32_t texelY1 = std::max(texelY0 + 1, (y + 1) * image.height / distributionHeight);
+
+		float* cdf = &conditionalCdf[(size_t)y * (distributionWidth + 1)];
+		cdf[0] = 0.0f;
+		for (uint32_t x = 0; x < distributionWidth; x++) {
+			uint32_t texelX0 = x * image.width / distributionWidth;
+			uint32_t texelX1 = std::max(texelX0 + 1, (x + 1) * image.width / distributionWidth);
+
+			glm::vec3 average(0.0f);
+			for (uint32_t texelY = texelY0; texelY < texelY1; texelY++) {
+				for (uint32_t texelX = texelX0; texelX < texelX1; texelX++) {
+					average += image.Texel(texelX, texelY);
+				}
+			}
+			average /= (float)((texelX1 - texelX0) * (texelY1 - texelY0));
+
+			float value = Utils::Luminance(average) * sinTheta;
+			cellFunction[(size_t)y * distributionWidth + x] = value;
+			cdf[x + 1] = cdf[x] + value;
+		}
+
+		float rowIntegral = cdf[distributionWidth];
+		for (uint32_t x = 1; x <= distributionWidth; x++) {
+			cdf[x] = rowIntegral > 0.0f ? cdf[x] / rowIntegral : (float)x / (float)distributionWidth;
+		}
+
+		marginalCdf[y + 1] = marginalCdf[y] + rowIntegral;
+	}
+
+	functionIntegral = marginalCdf[distributionHeight];
+	for (uint32_t y = 1; y <= distributionHeight; y++) {
+		marginalCdf[y] = functionIntegral > 0.0f ? marginalCdf[y] / functionIntegral : (float)y / (float)distributionHeight;
+	}
+}
+
+
+glm::vec3 EnvironmentMap::Lookup(const glm::vec3& direction) const {
+	glm::vec2 uv = Utils::DirectionToUV(direction);
+
+	uint32_t x = std::min((uint32_t)(glm::max(uv.x, 0.0f) * (float)image.width), image.width - 1);
+	uint32_t y = std::min((uint32_t)(glm::max(uv.y, 0.0f) * (float)image.height), image.height - 1);
+	return image.Texel(x, y);
+}
+
+
+float EnvironmentMap::CellPdf(uint32_t x, uint32_t y, float sinTheta) const {
+	if (sinTheta <= 0.0f) {
+		return 0.0f;
+	}
+
+	/*	the probability of the cell spread over its area in uv, then turned into solid angle -
+		a uv cell maps to 2pi * pi * sin(theta) times its area on the sphere	*/
+	float probability = cellFunction[(size_t)y * distributionWidth + x] / functionIntegral;
+	return probability * (float)(distributionWidth * distributionHeight) / (2.0f * Utils::Pi * Utils::Pi * sinTheta);
+}
+
+
+float EnvironmentMap::Sample(const glm::vec2& u, glm::vec3& direction) const {
+	if (functionIntegral <= 0.0f) {
+		return 0.0f;
+	}
+
+	float fractionY, fractionX;
+	uint32_t y = Utils::SampleCdf(marginalCdf.data(), distributionHeight, u.y, fractionY);
+	uint32_t x = Utils::SampleCdf(&conditionalCdf[(size_t)y * (distributionWidth + 1)], distributionWidth, u.x, fractionX);
+
+	float theta = ((float)y + fractionY) / (float)distributionHeight * Utils::Pi;
+	float phi = (((float)x + fractionX) / (float)distributionWidth - 0.5f) * 2.0f * Utils::Pi;
+
+	float sinTheta = std::sin(theta);
+	direction = glm::vec3(sinTheta * std::sin(phi), std::cos(theta), -sinTheta * std::cos(phi));
+
+	return CellPdf(x, y, sinTheta);
+}
+
+
+float EnvironmentMap::Pdf(const glm::vec3& direction) const {
+	if (functionIntegral <= 0.0f) {
+		return 0.0f;
+	}
+
+	glm::vec2 uv = Utils::DirectionToUV(direction);
+	uint32_t x = std::min((uint32_t)(glm::max(uv.x, 0.0f) * (float)distributionWidth), distributionWidth - 1);
+	uint32_t y = std::min((uint32_t)(glm::max(uv.y, 0.0f) * (float)distributionHeight), distributionHeight - 1);
+
+	float sinTheta = std::sqrt(glm::max(1.0f - direction.y * direction.y, 0.0f));
+	return CellPdf(x, y, sinTheta);
+}
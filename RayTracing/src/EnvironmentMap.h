@@ -0,0 +1,59 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+/*	HDR light surrounding the whole scene, whatever a ray sees when it doesn't hit anything -
+	stored as a latitude-longitude image, u goes around the y axis and v from +y (top row) to -y	*/
+class EnvironmentMap
+{
+public:
+	//	.hdr (radiance) files, loaded through the stb_image that Walnut already ships
+	bool Load(const std::string& filepath);
+
+	bool IsLoaded() const { return !image.texels.empty(); }
+	const std::string& GetFilepath() const { return filepath; }
+
+	//	radiance coming from the given direction, the nearest texel of the full resolution image
+	glm::vec3 Lookup(const glm::vec3& direction) const;
+
+	/*	picks a direction with a probability proportional to how bright the map is there, u is a pair
+		of uniform random numbers - returns the solid angle pdf of the direction, 0 if nothing can be sampled	*/
+	float Sample(const glm::vec2& u, glm::vec3& direction) const;
+
+	//	solid angle pdf Sample would have picked the direction with, needed to weight BSDF samples that miss
+	float Pdf(const glm::vec3& direction) const;
+private:
+	/*	the texels are kept in TileSize x TileSize tiles one after the other, so
+		lookups close to each other on the sphere stay in the same few cache lines	*/
+	struct Image {
+		uint32_t width = 0;
+		uint32_t height = 0;
+		uint32_t tilesPerRow = 0;
+		std::vector<glm::vec3> texels;
+
+		const glm::vec3& Texel(uint32_t x, uint32_t y) const;
+		glm::vec3& Texel(uint32_t x, uint32_t y);
+	};
+
+	static constexpr uint32_t TileSize = 8;
+	//	the sampling distribution has at most this many cells per row, each averaging a block of texels
+	static constexpr uint32_t MaxDistributionWidth = 256;
+
+	static Image CreateImage(uint32_t width, uint32_t height);
+	void BuildDistribution();
+	float CellPdf(uint32_t x, uint32_t y, float sinTheta) const;
+private:
+	std::string filepath;
+	Image image;
+
+	/*	a piecewise constant 2D distribution over cells covering blocks of texels - the
+		marginal cdf picks a row, the conditional cdf of that row picks a cell in it	*/
+	uint32_t distributionWidth = 0;
+	uint32_t distributionHeight = 0;
+	std::vector<float> cellFunction;	//	luminance * sin(theta) of every cell
+	std::vector<float> conditionalCdf;	//	distributionWidth + 1 entries per row
+	std::vector<float> marginalCdf;	//	distributionHeight + 1 entries
+	float functionIntegral = 0.0f;	//	sum of cellFunction
+};
@@ -0,0 +1,219 @@
+#include "Numa.h"
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+#if defined(WL_PLATFORM_WINDOWS)
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <Windows.h>
+#elif defined(__linux__)
+	#include <fstream>
+	#include <sstream>
+	#include <string>
+
+	#include <pthread.h>
+	#include <sched.h>
+	#include <sys/mman.h>
+#else
+	#include <cstdlib>
+#endif
+
+namespace Numa {
+
+	static Topology SingleNode() {
+		Topology topology;
+		Node& node = topology.nodes.emplace_back();
+
+		uint32_t processorCount = std::max(std::thread::hardware_concurrency(), 1u);
+		for (uint32_t i = 0; i < processorCount; i++) {
+			node.processors.push_back(i);
+		}
+		return topology;
+	}
+
+#if defined(WL_PLATFORM_WINDOWS)
+
+	static Topology DetectTopology() {
+		ULONG highestNode = 0;
+		if (!GetNumaHighestNodeNumber(&highestNode)) {
+			return SingleNode();
+		}
+
+		Topology topology;
+		for (USHORT id = 0; id <= highestNode; id++) {
+			GROUP_AFFINITY affinity{};
+			if (!GetNumaNodeProcessorMaskEx(id, &affinity) || affinity.Mask == 0) {
+				continue;
+			}
+
+			Node& node = topology.nodes.emplace_back();
+			node.id = id;
+			for (uint32_t bit = 0; bit < 64; bit++) {
+				if (affinity.Mask & ((KAFFINITY)1 << bit)) {
+					node.processors.push_back((uint32_t)affinity.Group * 64 + bit);
+				}
+			}
+		}
+
+		return topology.nodes.empty() ? SingleNode() : topology;
+	}
+
+	bool PinCurrentThread(uint32_t processor) {
+		GROUP_AFFINITY affinity{};
+		affinity.Group = (WORD)(processor / 64);
+		affinity.Mask = (KAFFINITY)1 << (processor % 64);
+		return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+	}
+
+	void* AllocatePages(size_t bytes) {
+		//	committed pages get their physical memory on the first access, not here
+		return VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	}
+
+	void FreePages(void* pages, size_t bytes) {
+		if (pages) {
+			VirtualFree(pages, 0, MEM_RELEASE);
+		}
+	}
+
+#elif defined(__linux__)
+
+	//	parses the "0-3,8-11" lists sysfs uses for the cpus of a node
+	static std::vector<uint32_t> ParseCpuList(const std::string& list) {
+		std::vector<uint32_t> cpus;
+		std::stringstream stream(list);
+		std::string range;
+		while (std::getline(stream, range, ',')) {
+			if (range.empty()) {
+				continue;
+			}
+
+			size_t dash = range.find('-');
+			uint32_t first = (uint32_t)std::stoul(range.substr(0, dash));
+			uint32_t last = dash == std::string::npos ? first : (uint32_t)std::stoul(range.substr(dash + 1));
+			for (uint32_t cpu = first; cpu <= last; cpu++) {
+				cpus.push_back(cpu);
+			}
+		}
+		return cpus;
+	}
+
+	/*	the cpus the process may run on - a cgroup, taskset or a container can allow a lot fewer
+		than the machine has, pinning a thread to any other cpu fails	*/
+	static bool GetAllowedCpus(cpu_set_t& allowed) {
+		CPU_ZERO(&allowed);
+		if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+			std::cerr << "Could not read the cpu affinity of the process, assuming every cpu is allowed\n";
+			return false;
+		}
+		return true;
+	}
+
+	static Topology DetectTopology() {
+		cpu_set_t allowed;
+		bool restricted = GetAllowedCpus(allowed);
+
+		Topology topology;
+
+		//	node ids can have gaps, but never a lot of them
+		for (uint32_t id = 0; id < 256; id++) {
+			std::ifstream file("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+			if (!file) {
+				continue;
+			}
+
+			std::string list;
+			std::getline(file, list);
+			std::vector<uint32_t> processors = ParseCpuList(list);
+			if (restricted) {
+				processors.erase(std::remove_if(processors.begin(), processors.end(), [&allowed](uint32_t cpu)
+					{
+						return cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed);
+					}), processors.end());
+			}
+			//	nodes without cpus (memory only), or none of whose cpus the process may use
+			if (processors.empty()) {
+				continue;
+			}
+
+			Node& node = topology.nodes.emplace_back();
+			node.id = id;
+			node.processors = std::move(processors);
+		}
+
+		if (!topology.nodes.empty()) {
+			return topology;
+		}
+
+		//	no sysfs, only the allowed cpus in a single node
+		if (!restricted) {
+			return SingleNode();
+		}
+
+		Node& node = topology.nodes.emplace_back();
+		for (uint32_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (CPU_ISSET(cpu, &allowed)) {
+				node.processors.push_back(cpu);
+			}
+		}
+		return node.processors.empty() ? SingleNode() : topology;
+	}
+
+	bool PinCurrentThread(uint32_t processor) {
+		if (processor >= CPU_SETSIZE) {
+			return false;
+		}
+
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(processor, &set);
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+	}
+
+	void* AllocatePages(size_t bytes) {
+		void* pages = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return pages == MAP_FAILED ? nullptr : pages;
+	}
+
+	void FreePages(void* pages, size_t bytes) {
+		if (pages) {
+			munmap(pages, bytes);
+		}
+	}
+
+#else
+
+	static Topology DetectTopology() {
+		return SingleNode();
+	}
+
+	bool PinCurrentThread(uint32_t processor) {
+		return false;
+	}
+
+	void* AllocatePages(size_t bytes) {
+		return std::malloc(bytes);
+	}
+
+	void FreePages(void* pages, size_t bytes) {
+		std::free(pages);
+	}
+
+#endif
+
+	uint32_t Topology::GetProcessorCount() const {
+		uint32_t count = 0;
+		for (const Node& node : nodes) {
+			count += (uint32_t)node.processors.size();
+		}
+		return count;
+	}
+
+	const Topology& GetTopology() {
+		static const Topology topology = DetectTopology();
+		return topology;
+	}
+
+}
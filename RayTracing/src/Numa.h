@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*	dual socket machines have memory attached to every socket (a NUMA node), reading
+	memory of the other socket is a lot slower than reading the local one - these are the
+	few OS calls needed to keep the render threads and the pixels they touch on the same node	*/
+namespace Numa {
+
+	struct Node {
+		uint32_t id = 0;
+		/*	logical processors of the node - on windows these are numbered
+			group * 64 + index in the group, on linux they are the cpu numbers	*/
+		std::vector<uint32_t> processors;
+	};
+
+	struct Topology {
+		std::vector<Node> nodes;
+
+		uint32_t GetProcessorCount() const;
+	};
+
+	/*	detected once and cached, machines without NUMA (or where it can't be detected) get a single node with every
+		processor - on linux only the processors the process is allowed to run on are listed, nodes left without any are dropped	*/
+	const Topology& GetTopology();
+
+	//	restricts the calling thread to one logical processor, returns false if the OS refused
+	bool PinCurrentThread(uint32_t processor);
+
+	/*	whole pages straight from the OS, nothing in them gets touched - the physical memory
+		ends up on the node of the thread that writes to a page first (first touch)	*/
+	void* AllocatePages(size_t bytes);
+	void FreePages(void* pages, size_t bytes);
+
+}
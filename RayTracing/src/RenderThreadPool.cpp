@@ -0,0 +1,125 @@
+#include "RenderThreadPool.h"
+
+#include <algorithm>
+#include <iostream>
+
+RenderThreadPool::RenderThreadPool(const Numa::Topology& topology, uint32_t nodeCount)
+	: nodeCount(std::clamp(nodeCount, 1u, (uint32_t)topology.nodes.size()))
+{
+	workersPerNode.resize(this->nodeCount);
+	for (uint32_t node = 0; node < this->nodeCount; node++) {
+		const std::vector<uint32_t>& processors = topology.nodes[node].processors;
+		workersPerNode[node] = (uint32_t)processors.size();
+
+		for (size_t i = 0; i < processors.size(); i++) {
+			Worker& worker = workers.emplace_back();
+			worker.node = node;
+			worker.processor = processors[i];
+			worker.firstOfNode = i == 0;
+		}
+	}
+
+	//	started only once the vector is done growing, the threads keep indices into it
+	for (uint32_t i = 0; i < (uint32_t)workers.size(); i++) {
+		workers[i].thread = std::thread(&RenderThreadPool::WorkerLoop, this, i);
+	}
+}
+
+
+RenderThreadPool::~RenderThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeCondition.notify_all();
+
+	for (Worker& worker : workers) {
+		worker.thread.join();
+	}
+}
+
+
+void RenderThreadPool::ForEachRow(uint32_t rowCount, const std::function<void(uint32_t row, uint32_t node)>& rowFunc, bool steal) {
+	struct Band {
+		std::atomic<uint32_t> next{ 0 };
+		uint32_t end = 0;
+	};
+
+	//	bands are as big as the share of the threads the node has
+	std::unique_ptr<Band[]> bands(new Band[nodeCount]);
+	uint32_t rowStart = 0;
+	uint32_t threadsBefore = 0;
+	for (uint32_t node = 0; node < nodeCount; node++) {
+		threadsBefore += workersPerNode[node];
+		uint32_t rowEnd = (uint32_t)((uint64_t)rowCount * threadsBefore / workers.size());
+
+		bands[node].next = rowStart;
+		bands[node].end = rowEnd;
+		rowStart = rowEnd;
+	}
+
+	Dispatch([&](uint32_t workerIndex) {
+		const uint32_t node = workers[workerIndex].node;
+
+		//	own band first, then the bands of the next nodes in turn
+		uint32_t bandCount = steal ? nodeCount : 1;
+		for (uint32_t i = 0; i < bandCount; i++) {
+			Band& band = bands[(node + i) % nodeCount];
+			for (uint32_t row = band.next++; row < band.end; row = band.next++) {
+				rowFunc(row, node);
+			}
+		}
+	});
+}
+
+
+void RenderThreadPool::ForEachNode(const std::function<void(uint32_t node)>& func) {
+	Dispatch([&](uint32_t workerIndex) {
+		if (workers[workerIndex].firstOfNode) {
+			func(workers[workerIndex].node);
+		}
+	});
+}
+
+
+void RenderThreadPool::Dispatch(const std::function<void(uint32_t worker)>& job) {
+	std::unique_lock<std::mutex> lock(mutex);
+	this->job = &job;
+	runningWorkers = (uint32_t)workers.size();
+	generation++;
+	wakeCondition.notify_all();
+
+	doneCondition.wait(lock, [this]() { return runningWorkers == 0; });
+	this->job = nullptr;
+}
+
+
+void RenderThreadPool::WorkerLoop(uint32_t workerIndex) {
+	//	a failed pin just leaves the thread to the scheduler, the rows still get rendered, only the placement suffers
+	if (!Numa::PinCurrentThread(workers[workerIndex].processor)) {
+		std::cerr << "Could not pin a render thread of node " << workers[workerIndex].node
+			<< " to processor " << workers[workerIndex].processor << "\n";
+	}
+
+	uint64_t seenGeneration = 0;
+	while (true) {
+		const std::function<void(uint32_t worker)>* currentJob;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeCondition.wait(lock, [this, seenGeneration]() { return stopping || generation != seenGeneration; });
+			if (stopping) {
+				return;
+			}
+
+			seenGeneration = generation;
+			currentJob = job;
+		}
+
+		(*currentJob)(workerIndex);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--runningWorkers == 0) {
+			doneCondition.notify_one();
+		}
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Numa.h"
+
+/*	worker threads pinned to the processors of the first nodeCount NUMA nodes - the rows of
+	a frame are split in one contiguous band per node, so every node keeps working on the
+	same part of the image, and the memory of that part can be placed on the node	*/
+class RenderThreadPool
+{
+public:
+	RenderThreadPool(const Numa::Topology& topology, uint32_t nodeCount);
+	~RenderThreadPool();
+
+	RenderThreadPool(const RenderThreadPool&) = delete;
+	RenderThreadPool& operator=(const RenderThreadPool&) = delete;
+
+	uint32_t GetNodeCount() const { return nodeCount; }
+	uint32_t GetThreadCount() const { return (uint32_t)workers.size(); }
+
+	/*	calls rowFunc(row, node) for every row, returns once all of them are done - with steal on,
+		workers that are done with their own band help the other nodes, placing memory with first touch
+		needs it off, so every row is guaranteed to be touched by its own node	*/
+	void ForEachRow(uint32_t rowCount, const std::function<void(uint32_t row, uint32_t node)>& rowFunc, bool steal = true);
+
+	//	calls func(node) once per node, on one of that node's workers
+	void ForEachNode(const std::function<void(uint32_t node)>& func);
+private:
+	struct Worker {
+		std::thread thread;
+		uint32_t node = 0;
+		uint32_t processor = 0;
+		bool firstOfNode = false;
+	};
+
+	//	runs job(worker index) on every worker and waits for all of them
+	void Dispatch(const std::function<void(uint32_t worker)>& job);
+	void WorkerLoop(uint32_t workerIndex);
+private:
+	uint32_t nodeCount = 0;
+	std::vector<uint32_t> workersPerNode;
+	std::vector<Worker> workers;
+
+	std::mutex mutex;
+	std::condition_variable wakeCondition;
+	std::condition_variable doneCondition;
+	const std::function<void(uint32_t worker)>* job = nullptr;
+	uint64_t generation = 0;
+	uint32_t runningWorkers = 0;
+	bool stopping = false;
+};
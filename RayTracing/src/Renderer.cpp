@@ -1,8 +1,14 @@
 #include "Renderer.h"
+#include "Walnut/Timer.h"
+
+#include <array>
 #include <execution>
+#include <new>
 
 namespace Utils {
 
+	static constexpr float Pi = 3.14159265358979f;
+
 	static uint32_t Vec4ToRGBA(const glm::vec4& color) {
 		uint8_t r = (uint8_t)(color.r * 255.0f);
 		uint8_t g = (uint8_t)(color.g * 255.0f);
@@ -33,6 +39,18 @@ namespace Utils {
 		return (float)seed / (float)std::numeric_limits<uint32_t>::max();
 	}
 
+	//	weight of a sample picked with pdf, when the same direction could also come from a strategy with otherPdf
+	static float PowerHeuristic(float pdf, float otherPdf) {
+		float pdfSquared = pdf * pdf;
+		return pdfSquared / (pdfSquared + otherPdf * otherPdf);
+	}
+
+	//	spheres and materials are plain floats and ints, comparing their bytes is enough to notice an edit
+	template<typename T>
+	static bool SameElements(const std::vector<T>& a, const std::vector<T>& b) {
+		return a.size() == b.size() && (a.empty() || memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+	}
+
 	static glm::vec3 InUnitSphere(uint32_t& seed) {
 		return glm::normalize(glm::vec3(
 			RandomFloat(seed) * 2.0f - 1.0f,
@@ -44,6 +62,13 @@ namespace Utils {
 }
 
 
+Renderer::~Renderer() {
+	//	the threads may still reference the buffers, so they go first
+	threadPool.reset();
+	FreeBuffers();
+}
+
+
 void Renderer::OnResize(uint32_t width, uint32_t height) {
 	if (finalImage) {
 		//	no resize necessary
@@ -63,11 +88,6 @@ void Renderer::OnResize(uint32_t width, uint32_t height) {
 		finalImage = std::make_shared<Walnut::Image>(width, height, Walnut::ImageFormat::RGBA);
 	}
 
-	delete[] imageData;
-	imageData = new uint32_t[width * height];
-	delete[] accumulationData;
-	accumulationData = new glm::vec4[width * height];
-
 	horizontalIter.resize(width);
 	verticalIter.resize(height);
 
@@ -78,6 +98,135 @@ void Renderer::OnResize(uint32_t width, uint32_t height) {
 		verticalIter[i] = i;
 	}
 
+	AllocateBuffers(width, height);
+}
+
+
+void Renderer::AllocateBuffers(uint32_t width, uint32_t height) {
+	FreeBuffers();
+
+	rayDirectionsCamera = nullptr;
+	bufferPixels = (size_t)width * height;
+	//	a minimized window has no pixels, and there are no pages to map for zero bytes
+	if (bufferPixels == 0) {
+		return;
+	}
+
+	imageData = (uint32_t*)Numa::AllocatePages(bufferPixels * sizeof(uint32_t));
+	accumulationData = (glm::vec4*)Numa::AllocatePages(bufferPixels * sizeof(glm::vec4));
+	if (!imageData || !accumulationData) {
+		throw std::bad_alloc();
+	}
+
+	if (!threadPool) {
+		return;
+	}
+
+	//	first touch - a row's pages end up on the node of the thread that writes them here,
+	//	localRayDirections is only allocated once something reads it, see UpdateRayDirections
+	threadPool->ForEachRow(height, [this, width](uint32_t row, uint32_t node)
+		{
+			memset(imageData + (size_t)row * width, 0, width * sizeof(uint32_t));
+			memset(accumulationData + (size_t)row * width, 0, width * sizeof(glm::vec4));
+		}, false);
+}
+
+
+void Renderer::FreeBuffers() {
+	Numa::FreePages(imageData, bufferPixels * sizeof(uint32_t));
+	Numa::FreePages(accumulationData, bufferPixels * sizeof(glm::vec4));
+	Numa::FreePages(localRayDirections, bufferPixels * sizeof(glm::vec3));
+
+	imageData = nullptr;
+	accumulationData = nullptr;
+	localRayDirections = nullptr;
+	bufferPixels = 0;
+}
+
+
+void Renderer::SetThreadPool(std::unique_ptr<RenderThreadPool> pool) {
+	threadPool = std::move(pool);
+	nodeScenes.clear();
+	nodeScenes.resize(threadPool ? threadPool->GetNodeCount() : 0);
+	replicatedEnvironment.reset();
+
+	//	whatever was placed for the old threads is in the wrong spot now, so the accumulation starts over
+	if (finalImage) {
+		AllocateBuffers(finalImage->GetWidth(), finalImage->GetHeight());
+	}
+	ResetFrameIndex();
+}
+
+
+void Renderer::UpdateThreadPool() {
+	if (settings.numaAware == numaAwareActive) {
+		return;
+	}
+	numaAwareActive = settings.numaAware;
+
+	if (numaAwareActive) {
+		const Numa::Topology& topology = Numa::GetTopology();
+		SetThreadPool(std::make_unique<RenderThreadPool>(topology, (uint32_t)topology.nodes.size()));
+	}
+	else {
+		SetThreadPool(nullptr);
+	}
+}
+
+
+void Renderer::UpdateRayDirections() {
+	const std::vector<glm::vec3>& cameraRayDirections = activeCamera->GetRayDirections();
+	//	jittered rays are calculated from the camera's basis for every sample, the cached ones aren't read then
+	if (!threadPool || jitterCameraRays || cameraRayDirections.size() != bufferPixels) {
+		rayDirections = cameraRayDirections.data();
+		return;
+	}
+
+	if (!localRayDirections) {
+		//	the copy below is the first touch that places the pages
+		localRayDirections = (glm::vec3*)Numa::AllocatePages(bufferPixels * sizeof(glm::vec3));
+		if (!localRayDirections) {
+			throw std::bad_alloc();
+		}
+		rayDirectionsCamera = nullptr;
+	}
+
+	//	copied only when the camera recalculated them, by the same node that renders the rows
+	if (rayDirectionsCamera != activeCamera || rayDirectionsVersion != activeCamera->GetRayDirectionsVersion()) {
+		const uint32_t width = finalImage->GetWidth();
+		const glm::vec3* source = cameraRayDirections.data();
+		threadPool->ForEachRow(finalImage->GetHeight(), [this, width, source](uint32_t row, uint32_t node)
+			{
+				memcpy(localRayDirections + (size_t)row * width, source + (size_t)row * width, width * sizeof(glm::vec3));
+			}, false);
+
+		rayDirectionsCamera = activeCamera;
+		rayDirectionsVersion = activeCamera->GetRayDirectionsVersion();
+	}
+	rayDirections = localRayDirections;
+}
+
+
+void Renderer::ReplicateScene(const Scene& scene) {
+	/*	the spheres and materials are a few hundred bytes, copied again only after an edit - the environment
+		map is the big part, hit at random on every miss and light sample, copied only when another one is set	*/
+	const bool environmentChanged = replicatedEnvironment != scene.environment;
+	const Scene& replica = nodeScenes[0];
+	if (!environmentChanged && Utils::SameElements(replica.objects, scene.objects) && Utils::SameElements(replica.materials, scene.materials)) {
+		return;
+	}
+
+	//	the copies are made by a thread of the node, so their memory lands there
+	threadPool->ForEachNode([this, &scene, environmentChanged](uint32_t node)
+		{
+			Scene& replica = nodeScenes[node];
+			replica.objects = scene.objects;
+			replica.materials = scene.materials;
+			if (environmentChanged) {
+				replica.environment = scene.environment ? std::make_shared<EnvironmentMap>(*scene.environment) : nullptr;
+			}
+		});
+	replicatedEnvironment = scene.environment;
 }
 
 
@@ -87,6 +236,53 @@ void Renderer::Render(const Scene& scene, const Camera& camera) {
 	activeScene = &scene;
 	activeCamera = &camera;
 
+	//	nothing to render into, and nothing to upload
+	if (bufferPixels == 0) {
+		return;
+	}
+
+	samplesPerPixel = (uint32_t)glm::max(settings.samplesPerPixel, 1);
+	strataPerAxis = (uint32_t)glm::ceil(glm::sqrt((float)samplesPerPixel));
+	jitterCameraRays = samplesPerPixel > 1 || (settings.accumulate && settings.antiAliasing);
+	//	counted instead of frameIndex * samplesPerPixel, the sample count may change while accumulating
+	accumulatedSamples = (frameIndex == 1 ? 0 : accumulatedSamples) + samplesPerPixel;
+
+	UpdateThreadPool();
+	UpdateRayDirections();	//	needs to know whether the rays get jittered
+	if (threadPool && settings.replicateScene) {
+		ReplicateScene(scene);
+	}
+
+	if (settings.specializedKernels) {
+		bool environment = scene.environment && scene.environment->IsLoaded();
+		bool emissive = false;
+		for (const Material& material : scene.materials) {
+			if (material.emissionPower > 0.0f && glm::dot(material.emissionColor, material.emissionColor) > 0.0f) {
+				emissive = true;
+				break;
+			}
+		}
+
+		KernelFn kernel = SelectKernel(settings, emissive, environment, jitterCameraRays);
+		(this->*kernel)();
+	}
+	else {
+		RenderGeneric();
+	}
+
+	// uploading pixel data to the GPU
+	finalImage->SetData(imageData);
+
+	if (settings.accumulate) {
+		frameIndex++;
+	}
+	else {
+		frameIndex = 1;
+	}
+}
+
+
+void Renderer::RenderGeneric() {
 	//	if it is frame 1 then we have no data, so the buffer has to get cleared all across the image
 	if (frameIndex == 1) {
 		memset(accumulationData, 0, finalImage->GetHeight() * finalImage->GetWidth() * sizeof(glm::vec4));
@@ -98,55 +294,319 @@ void Renderer::Render(const Scene& scene, const Camera& camera) {
 */
 #define MT 1
 #if MT
-	std::for_each(std::execution::par, verticalIter.begin(), verticalIter.end(),
-		[this](uint32_t y)
+	auto renderPixel = [this](uint32_t x, uint32_t y)
+		{
+			glm::vec4 color(0.0f);
+			for (uint32_t sample = 0; sample < samplesPerPixel; sample++) {
+				color += PerPixel(x, y, sample);
+			}
+			accumulationData[x + y * finalImage->GetWidth()] += color;	//	doesn't have to be clamped, because accumulationData accepts floats
+
+			//	without normalizing it, the image would become unnaturally bright
+			glm::vec4 accumulatedColor = accumulationData[x + y * finalImage->GetWidth()];
+			accumulatedColor /= (float)accumulatedSamples;
+
+			accumulatedColor = glm::clamp(accumulatedColor, glm::vec4(0.0f), glm::vec4(1.0f));
+			imageData[x + y * finalImage->GetWidth()] = Utils::Vec4ToRGBA(accumulatedColor);
+		};
+
+	if (genericRowTasks) {
+		//	the work split like the kernels split it, a task per row
+		const uint32_t width = finalImage->GetWidth();
+		ForEachRow([&renderPixel, width](uint32_t y, const Scene&)
 			{
-				std::for_each(std::execution::par, horizontalIter.begin(), horizontalIter.end(),
-					[this, y](uint32_t x)
-					{
-						glm::vec4 color = PerPixel(x, y);
-						accumulationData[x + y * finalImage->GetWidth()] += color;	//	doesn't have to be clamped, because accumulationData accepts floats
-
-						//	without normalizing it, the image would become unnaturally bright
-						glm::vec4 accumulatedColor = accumulationData[x + y * finalImage->GetWidth()];
-						accumulatedColor /= (float)frameIndex;
-
-						accumulatedColor = glm::clamp(accumulatedColor, glm::vec4(0.0f), glm::vec4(1.0f));
-						imageData[x + y * finalImage->GetWidth()] = Utils::Vec4ToRGBA(accumulatedColor);
-					});
+				for (uint32_t x = 0; x < width; x++) {
+					renderPixel(x, y);
+				}
 			});
+	}
+	else {
+		std::for_each(std::execution::par, verticalIter.begin(), verticalIter.end(),
+			[this, &renderPixel](uint32_t y)
+				{
+					std::for_each(std::execution::par, horizontalIter.begin(), horizontalIter.end(),
+						[&renderPixel, y](uint32_t x)
+						{
+							renderPixel(x, y);
+						});
+				});
+	}
 #else
 	for (uint32_t y = 0; y < finalImage->GetHeight(); y++) {
 		for (uint32_t x = 0; x < finalImage->GetWidth(); x++) {
-			glm::vec4 color = PerPixel(x, y);
+			glm::vec4 color(0.0f);
+			for (uint32_t sample = 0; sample < samplesPerPixel; sample++) {
+				color += PerPixel(x, y, sample);
+			}
 			accumulationData[x + y * finalImage->GetWidth()] += color;	//	doesn't have to be clamped, because accumulationData accepts floats
 
 			//	without normalizing it, the image would become unnaturally bright
 			glm::vec4 accumulatedColor = accumulationData[x + y * finalImage->GetWidth()];
-			accumulatedColor /= (float)frameIndex;
+			accumulatedColor /= (float)accumulatedSamples;
 
-			accumulatedColor = glm::clamp(color, glm::vec4(0.0f), glm::vec4(1.0f));
+			accumulatedColor = glm::clamp(accumulatedColor, glm::vec4(0.0f), glm::vec4(1.0f));
 			imageData[x + y * finalImage->GetWidth()] = Utils::Vec4ToRGBA(accumulatedColor);
 		}
 	}
 #endif
+}
 
-	// uploading pixel data to the GPU
-	finalImage->SetData(imageData);
 
-	if (settings.accumulate) {
-		frameIndex++;
+template<typename RowFunc>
+void Renderer::ForEachRow(RowFunc&& rowFunc) {
+	if (!threadPool) {
+		std::for_each(std::execution::par, verticalIter.begin(), verticalIter.end(), [this, &rowFunc](uint32_t row)
+			{
+				rowFunc(row, *activeScene);
+			});
+		return;
 	}
-	else {
-		frameIndex = 1;
+
+	//	picked once per row, the rays of the row get the scene handed down from here
+	const bool replicate = settings.replicateScene;
+	threadPool->ForEachRow(finalImage->GetHeight(), [this, replicate, &rowFunc](uint32_t row, uint32_t node)
+		{
+			rowFunc(row, replicate ? nodeScenes[node] : *activeScene);
+		});
+}
+
+
+template<bool SlowRandom, bool Accumulate, bool Emissive, bool Environment, bool Jitter, int Bounces>
+void Renderer::RenderKernel() {
+	//	read once per frame instead of through the shared_ptr for every pixel
+	const uint32_t width = finalImage->GetWidth();
+	const uint32_t sampleCount = samplesPerPixel;
+	//	the divider of the accumulated sum, this frame adds sampleCount paths to it
+	const float invSampleCount = 1.0f / (float)(Accumulate ? accumulatedSamples : sampleCount);
+	/*	instead of clearing the whole buffer from one thread when accumulation (re)starts, the
+		first frame overwrites it - every row is written by the thread that renders it	*/
+	const bool firstFrame = frameIndex == 1;
+
+	//	a task per row is enough work to keep every core busy, the inner loop stays
+	//	a plain loop so that PerPixelKernel can be inlined into it
+	ForEachRow([this, width, sampleCount, invSampleCount, firstFrame](uint32_t y, const Scene& scene)
+		{
+			const uint32_t rowStart = y * width;
+			for (uint32_t x = 0; x < width; x++) {
+				const uint32_t index = rowStart + x;
+
+				//	the samples are summed in registers, the buffers see a single write per pixel
+				glm::vec4 color(0.0f);
+				for (uint32_t sample = 0; sample < sampleCount; sample++) {
+					color += PerPixelKernel<SlowRandom, Emissive, Environment, Jitter, Bounces>(scene, x, y, index, sample);
+				}
+
+				if constexpr (Accumulate) {
+					if (firstFrame) {
+						accumulationData[index] = color;
+					}
+					else {
+						accumulationData[index] += color;
+						color = accumulationData[index];
+					}
+				}
+				color *= invSampleCount;
+
+				color = glm::clamp(color, glm::vec4(0.0f), glm::vec4(1.0f));
+				imageData[index] = Utils::Vec4ToRGBA(color);
+			}
+		});
+}
+
+
+template<bool SlowRandom, bool Emissive, bool Environment, bool Jitter, int Bounces>
+glm::vec4 Renderer::PerPixelKernel(const Scene& scene, uint32_t x, uint32_t y, uint32_t index, uint32_t sample) {
+	uint32_t seed = index * frameIndex + sample * 0x9e3779b9u;
+	Ray ray = GenerateCameraRay<Jitter>(x, y, index, sample, seed);
+
+	glm::vec3 light(0.0f);
+	glm::vec3 lightColorContribution(1.0f);
+	float bsdfPdf = 0.0f;
+
+	for (int i = 0; i < Bounces; i++) {
+		Renderer::HitPayload payload = TraceRay(scene, ray);
+		seed += i;
+
+		if (payload.hitDistance < 0.0f) {
+			if constexpr (Environment) {
+				light += lightColorContribution * EnvironmentMiss(scene, ray.direction, bsdfPdf);
+			}
+			break;
+		}
+
+		const Sphere& sphere = scene.objects[payload.objectIndex];
+		const Material& material = scene.materials[sphere.materialIndex];
+
+		lightColorContribution *= material.albedo;
+		if constexpr (Emissive) {
+			light += material.GetEmission();
+		}
+
+		ray.origin = payload.worldPosition + payload.worldNormal * 0.0001f;
+		if constexpr (SlowRandom) {
+			if constexpr (Environment) {
+				light += lightColorContribution * SampleEnvironment(scene, payload, { Walnut::Random::Float(), Walnut::Random::Float() }, i == Bounces - 1);
+			}
+			ray.direction = glm::normalize(payload.worldNormal + Walnut::Random::InUnitSphere());
+		}
+		else {
+			if constexpr (Environment) {
+				float u = Utils::RandomFloat(seed);
+				light += lightColorContribution * SampleEnvironment(scene, payload, { u, Utils::RandomFloat(seed) }, i == Bounces - 1);
+			}
+			ray.direction = glm::normalize(payload.worldNormal + Utils::InUnitSphere(seed));
+		}
+		bsdfPdf = glm::max(glm::dot(payload.worldNormal, ray.direction), 0.0f) / Utils::Pi;
 	}
+
+	return glm::vec4(light, 1.0f);
+}
+
+
+/*	every combination of the settings gets its own kernel, the index packs them as bit 0 - slowRandom,
+	bit 1 - accumulate, bit 2 - emissive, bit 3 - environment, bit 4 - jitter, the rest - bounces - 1	*/
+template<size_t... I>
+constexpr auto Renderer::MakeKernelTable(std::index_sequence<I...>) {
+	return std::array<KernelFn, sizeof...(I)>{
+		&Renderer::RenderKernel<(I & 1) != 0, (I & 2) != 0, (I & 4) != 0, (I & 8) != 0, (I & 16) != 0, (int)(I >> 5) + 1>...
+	};
 }
 
 
-glm::vec4 Renderer::PerPixel(uint32_t x, uint32_t y) {
+Renderer::KernelFn Renderer::SelectKernel(const Settings& settings, bool emissive, bool environment, bool jitter) {
+	static constexpr auto kernels = MakeKernelTable(std::make_index_sequence<32 * MaxBounces>{});
+
+	size_t bounces = (size_t)glm::clamp(settings.bounces, 1, MaxBounces);
+	size_t index = (settings.slowRandom ? 1 : 0)
+		| (settings.accumulate ? 2 : 0)
+		| (emissive ? 4 : 0)
+		| (environment ? 8 : 0)
+		| (jitter ? 16 : 0)
+		| ((bounces - 1) << 5);
+
+	return kernels[index];
+}
+
+
+std::vector<Renderer::KernelBenchmark> Renderer::BenchmarkKernels(const Scene& scene, const Camera& camera, uint32_t frames) {
+	std::vector<KernelBenchmark> results;
+	Settings savedSettings = settings;
+	genericRowTasks = true;
+
+	for (int variant = 0; variant < 4; variant++) {
+		settings.slowRandom = (variant & 1) != 0;
+		settings.accumulate = (variant & 2) != 0;
+
+		KernelBenchmark& result = results.emplace_back();
+		result.name = std::string(settings.slowRandom ? "slow random" : "fast random")
+			+ (settings.accumulate ? ", accumulate" : ", no accumulate")
+			+ ", " + std::to_string(settings.bounces) + " bounces";
+
+		for (bool specialized : { false, true }) {
+			settings.specializedKernels = specialized;
+
+			//	one frame up front, so whichever variant comes first doesn't pay for the caches and the thread startup
+			ResetFrameIndex();
+			Render(scene, camera);
+
+			Walnut::Timer timer;
+			for (uint32_t i = 0; i < frames; i++) {
+				Render(scene, camera);
+			}
+			float averageMs = timer.ElapsedMillis() / (float)frames;
+
+			if (specialized) {
+				result.specializedMs = averageMs;
+			}
+			else {
+				result.genericMs = averageMs;
+			}
+		}
+	}
+
+	genericRowTasks = false;
+	settings = savedSettings;
+	ResetFrameIndex();
+	return results;
+}
+
+
+std::vector<Renderer::NumaBenchmark> Renderer::BenchmarkNuma(const Scene& scene, const Camera& camera, uint32_t frames) {
+	std::vector<NumaBenchmark> results;
+	const Numa::Topology& topology = Numa::GetTopology();
+
+	Settings savedSettings = settings;
+	settings.specializedKernels = true;
+	settings.numaAware = false;
+	settings.replicateScene = false;
+	UpdateThreadPool();
+
+	auto measure = [&](const std::string& name, uint32_t threads) {
+		//	one frame up front, so copying the ray directions and placing them isn't timed
+		ResetFrameIndex();
+		Render(scene, camera);
+
+		Walnut::Timer timer;
+		for (uint32_t i = 0; i < frames; i++) {
+			Render(scene, camera);
+		}
+
+		NumaBenchmark& result = results.emplace_back();
+		result.name = name;
+		result.threads = threads;
+		result.frameMs = timer.ElapsedMillis() / (float)frames;
+	};
+
+	measure("std::execution::par", std::thread::hardware_concurrency());
+
+	//	the pool is set directly, settings.numaAware stays off so Render leaves it alone
+	for (uint32_t nodes = 1; nodes <= (uint32_t)topology.nodes.size(); nodes++) {
+		SetThreadPool(std::make_unique<RenderThreadPool>(topology, nodes));
+		measure(std::to_string(nodes) + (nodes == 1 ? " node" : " nodes"), threadPool->GetThreadCount());
+	}
+
+	settings.replicateScene = true;
+	measure(std::to_string(threadPool->GetNodeCount()) + " nodes, replicated scene", threadPool->GetThreadCount());
+
+	SetThreadPool(nullptr);
+	settings = savedSettings;
+	return results;
+}
+
+
+template<bool Jitter>
+Ray Renderer::GenerateCameraRay(uint32_t x, uint32_t y, uint32_t index, uint32_t sample, uint32_t& seed) const {
 	Ray ray;
 	ray.origin = activeCamera->GetPosition();
-	ray.direction = activeCamera->GetRayDirections()[x + y * finalImage->GetWidth()];
+
+	if constexpr (Jitter) {
+		/*	when the sample count isn't a square number some strata stay empty in a frame -
+			starting further along the grid every frame spreads the samples over all of them	*/
+		const uint32_t strataCount = strataPerAxis * strataPerAxis;
+		const uint32_t stratum = (sample + frameIndex * samplesPerPixel) % strataCount;
+
+		glm::vec2 offset;
+		offset.x = ((float)(stratum % strataPerAxis) + Utils::RandomFloat(seed)) / (float)strataPerAxis;
+		offset.y = ((float)(stratum / strataPerAxis) + Utils::RandomFloat(seed)) / (float)strataPerAxis;
+
+		ray.direction = activeCamera->CalculateRayDirection(glm::vec2((float)x, (float)y) + offset);
+	}
+	else {
+		ray.direction = rayDirections[index];
+	}
+	return ray;
+}
+
+
+glm::vec4 Renderer::PerPixel(uint32_t x, uint32_t y, uint32_t sample) {
+	uint32_t seed = x + y * finalImage->GetWidth();
+	seed *= frameIndex;
+	seed += sample * 0x9e3779b9u;
+
+	Ray ray = jitterCameraRays
+		? GenerateCameraRay<true>(x, y, x + y * finalImage->GetWidth(), sample, seed)
+		: GenerateCameraRay<false>(x, y, x + y * finalImage->GetWidth(), sample, seed);
+	const Scene& scene = *activeScene;
 
 	glm::vec3 light(0.0f);
 	//	as light bounces, some wavelength will be absorbed, and some
@@ -156,27 +616,30 @@ glm::vec4 Renderer::PerPixel(uint32_t x, uint32_t y) {
 	glm::vec3 lightColorContribution(1.0f);
 
 	//	bounces are used to make the spheres reflect their image on themselves, kinda like mirrors
-	int bounces = 5;
+	int bounces = settings.bounces;
 
-	uint32_t seed = x + y * finalImage->GetWidth();
-	seed *= frameIndex;
+	const bool environment = scene.environment && scene.environment->IsLoaded();
+	float bsdfPdf = 0.0f;	//	of the direction the current ray was bounced in, 0 for the camera ray
 
 	for (int i = 0; i < bounces; i++) {
-		Renderer::HitPayload payload = TraceRay(ray);
+		Renderer::HitPayload payload = TraceRay(scene, ray);
 		seed += i;
 
 		if (payload.hitDistance < 0.0f) {
 			//	ambient occlusion - important term for realistic rendering
 			glm::vec3 skyColor = glm::vec3(0.6f, 0.7f, 0.9f);
 			//light += skyColor * lightColorContribution; 
+			if (environment) {
+				light += lightColorContribution * EnvironmentMiss(scene, ray.direction, bsdfPdf);
+			}
 			break;
 		}
 
 		//glm::vec3 lightDir = glm::normalize(glm::vec3(-1, -1, -1));
 		//float lightIntensity = glm::max(glm::dot(payload.worldNormal, -lightDir), 0.0f); // == cos(angle)
 
-		const Sphere& sphere = activeScene->objects[payload.objectIndex];
-		const Material& material = activeScene->materials[sphere.materialIndex];
+		const Sphere& sphere = scene.objects[payload.objectIndex];
+		const Material& material = scene.materials[sphere.materialIndex];
 		
 
 		lightColorContribution *= material.albedo;
@@ -185,11 +648,20 @@ glm::vec4 Renderer::PerPixel(uint32_t x, uint32_t y) {
 		ray.origin = payload.worldPosition + payload.worldNormal * 0.0001f;
 		//	adding random noise to the reflected rays, representing the roughness of a surface
 		if (settings.slowRandom) {
+			if (environment) {
+				light += lightColorContribution * SampleEnvironment(scene, payload, { Walnut::Random::Float(), Walnut::Random::Float() }, i == bounces - 1);
+			}
 			ray.direction = glm::normalize(payload.worldNormal + Walnut::Random::InUnitSphere());
 		}
 		else{
+			if (environment) {
+				float u = Utils::RandomFloat(seed);
+				light += lightColorContribution * SampleEnvironment(scene, payload, { u, Utils::RandomFloat(seed) }, i == bounces - 1);
+			}
 			ray.direction = glm::normalize(payload.worldNormal + Utils::InUnitSphere(seed));
 		}
+		//	normal + a point on the unit sphere is cosine distributed around the normal
+		bsdfPdf = glm::max(glm::dot(payload.worldNormal, ray.direction), 0.0f) / Utils::Pi;
 
 	}
 
@@ -197,12 +669,54 @@ glm::vec4 Renderer::PerPixel(uint32_t x, uint32_t y) {
 }
 
 
-Renderer::HitPayload Renderer::TraceRay(const Ray& ray) {
+glm::vec3 Renderer::EnvironmentMiss(const Scene& scene, const glm::vec3& direction, float bsdfPdf) const {
+	const EnvironmentMap& environment = *scene.environment;
+	glm::vec3 radiance = environment.Lookup(direction);
+
+	//	the camera ray can't be picked by sampling the environment, so it keeps all of it
+	if (bsdfPdf > 0.0f) {
+		radiance *= Utils::PowerHeuristic(bsdfPdf, environment.Pdf(direction));
+	}
+	return radiance;
+}
+
+
+glm::vec3 Renderer::SampleEnvironment(const Scene& scene, const HitPayload& payload, const glm::vec2& u, bool lastBounce) {
+	const EnvironmentMap& environment = *scene.environment;
+
+	glm::vec3 direction;
+	float lightPdf = environment.Sample(u, direction);
+	float cosTheta = glm::dot(payload.worldNormal, direction);
+	if (lightPdf <= 0.0f || cosTheta <= 0.0f) {
+		return glm::vec3(0.0f);
+	}
+
+	Ray shadowRay;
+	shadowRay.origin = payload.worldPosition + payload.worldNormal * 0.0001f;
+	shadowRay.direction = direction;
+	if (TraceRay(scene, shadowRay).hitDistance >= 0.0f) {
+		return glm::vec3(0.0f);
+	}
+
+	/*	the albedo is already in the contribution the caller multiplies with,
+		what's left of the lambertian brdf * cos is cos / pi - the bsdf pdf itself	*/
+	float bsdfPdf = cosTheta / Utils::Pi;
+	glm::vec3 radiance = environment.Lookup(direction) * (bsdfPdf / lightPdf);
+
+	//	after the last bounce no ray gets traced that could miss and add the other share, so this one takes all of it
+	if (!lastBounce) {
+		radiance *= Utils::PowerHeuristic(lightPdf, bsdfPdf);
+	}
+	return radiance;
+}
+
+
+Renderer::HitPayload Renderer::TraceRay(const Scene& scene, const Ray& ray) {
 	int closestSphere = -1;
 	float hitDistance = FLT_MAX;
 
-	for (size_t i = 0; i < activeScene->objects.size(); i++) {
-		const Sphere& sphere = activeScene->objects[i];
+	for (size_t i = 0; i < scene.objects.size(); i++) {
+		const Sphere& sphere = scene.objects[i];
 		glm::vec3 origin = ray.origin - sphere.position;
 
 		float a = glm::dot(ray.direction, ray.direction);
@@ -230,17 +744,17 @@ Renderer::HitPayload Renderer::TraceRay(const Ray& ray) {
 		return Miss(ray);
 	}
 
-	return ClosestHit(ray, hitDistance, closestSphere);
+	return ClosestHit(scene, ray, hitDistance, closestSphere);
 }
 
 
-Renderer::HitPayload Renderer::ClosestHit(const Ray& ray, float hitDistance, int objectIndex){
+Renderer::HitPayload Renderer::ClosestHit(const Scene& scene, const Ray& ray, float hitDistance, int objectIndex){
 
 	Renderer::HitPayload payload{};
 	payload.hitDistance = hitDistance;
 	payload.objectIndex = objectIndex;
 
-	const Sphere& closestSphere = activeScene->objects[objectIndex];
+	const Sphere& closestSphere = scene.objects[objectIndex];
 
 	glm::vec3 origin = ray.origin - closestSphere.position;
 	payload.worldPosition = origin + ray.direction * hitDistance;
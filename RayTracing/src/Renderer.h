@@ -6,10 +6,14 @@
 #include <memory>
 #include <list>
 #include <iostream>
+#include <string>
+#include <vector>
+#include <utility>
 
 #include "Camera.h"
 #include "Ray.h"
 #include "Scene.h"
+#include "RenderThreadPool.h"
 
 
 
@@ -24,14 +28,60 @@ public:
 	struct Settings {
 		bool accumulate = true;
 		bool slowRandom = true;
+		int bounces = 5;	//	1..MaxBounces, the kernels are compiled for every value in that range
+		/*	if it's on - a kernel compiled for exactly these settings is picked once per frame,
+			if it's off - the generic PerPixel is used, branching on the settings for every pixel	*/
+		bool specializedKernels = true;
+		/*	paths traced per pixel in a single Render call, summed up before touching the buffers, so
+			the clear, the resolve and the upload are paid once for all of them - with more than one
+			the samples get jittered over a grid of strata inside the pixel, which also anti-aliases edges	*/
+		int samplesPerPixel = 1;
+		/*	jitters the camera rays inside the pixel while accumulating even with a single sample per pixel, so the
+			accumulated image gets anti-aliased too - off, those rays go through the pixel corners like the cached ones	*/
+		bool antiAliasing = true;
+		/*	renders the specialized kernels on threads pinned to every NUMA node, each node gets its own band of
+			rows and the memory of that band (pixels, accumulation) is placed on the node - the cached camera
+			ray directions as well, when they are read, with a single sample per pixel and no antiAliasing	*/
+		bool numaAware = false;
+		/*	on top of that, every node reads from its own copy of the scene, the environment map included -
+			copied again only when the spheres or materials were edited, or another environment map was set	*/
+		bool replicateScene = false;
+	};
+
+	//	the highest bounce count a specialized kernel gets instantiated for
+	static constexpr int MaxBounces = 8;
+
+	//	average frame times of one settings variant, generic path vs its specialized kernel
+	struct KernelBenchmark {
+		std::string name;
+		float genericMs = 0.0f;
+		float specializedMs = 0.0f;
+	};
+
+	//	average frame time with the render threads spread over a number of NUMA nodes
+	struct NumaBenchmark {
+		std::string name;
+		uint32_t threads = 0;
+		float frameMs = 0.0f;
 	};
 public:
 	Renderer() = default; // for now
+	~Renderer();
 	void OnResize(uint32_t width, uint32_t height);
 	void Render(const Scene& scene, const Camera& camera);
 	std::shared_ptr<Walnut::Image> GetFinalImage() const { return finalImage; }
+	const uint32_t* GetImageData() const { return imageData; }	//	RGBA8 pixels of the last frame, same layout as finalImage
 	void ResetFrameIndex() { frameIndex = 1; }
 	Settings& GetSettings() { return settings; }
+
+	/*	renders every slowRandom/accumulate combination at the current bounce count with both
+		the generic and the specialized path, the accumulated image is reset afterwards - the generic
+		path runs a task per row there, like the kernels, so only the specialization gets measured	*/
+	std::vector<KernelBenchmark> BenchmarkKernels(const Scene& scene, const Camera& camera, uint32_t frames = 16);
+
+	/*	renders with std::execution::par, then with the pinned threads of 1, 2, ... NUMA nodes and
+		finally with the scene replicated on all of them, the accumulated image is reset afterwards	*/
+	std::vector<NumaBenchmark> BenchmarkNuma(const Scene& scene, const Camera& camera, uint32_t frames = 16);
 private:	
 
 	struct HitPayload {
@@ -42,19 +92,60 @@ private:
 		//	Sphere* recentlyHitObject;	//	reference to a recently hit sphere
 	};
 
-	glm::vec4 PerPixel(uint32_t x, uint32_t y);	//	the color gets determined here on the basis of the return value of hitDistance in HitPayload from TraceRay
-	HitPayload TraceRay(const Ray& ray);	//	does not return color  now
+	glm::vec4 PerPixel(uint32_t x, uint32_t y, uint32_t sample);	//	the color gets determined here on the basis of the return value of hitDistance in HitPayload from TraceRay
+	HitPayload TraceRay(const Scene& scene, const Ray& ray);	//	does not return color  now
 
 	/*	if the ray in TraceRay hits something, ClosestHit shader is called and determines
 		the worldPosition and worldNormal parameters	*/
-	HitPayload ClosestHit(const Ray& ray, float hitDistance, int objectIndex);	
+	HitPayload ClosestHit(const Scene& scene, const Ray& ray, float hitDistance, int objectIndex);	
 	HitPayload Miss(const Ray& ray);	//	if the ray in TraceRay misses everythin, this gets called
 
+	/*	the environment map is lit both ways - a ray bounced off a surface can miss everything and see it,
+		and at every hit a direction is picked from the map itself and checked with a shadow ray -
+		multiple importance sampling weights both of them, so neither counts the light twice	*/
+	glm::vec3 EnvironmentMiss(const Scene& scene, const glm::vec3& direction, float bsdfPdf) const;
+	glm::vec3 SampleEnvironment(const Scene& scene, const HitPayload& payload, const glm::vec2& u, bool lastBounce);
+
+	/*	the same frame as RenderGeneric, but with every setting baked in at compile time,
+		so the bounce loop has a fixed trip count and there are no per-pixel branches on settings	*/
+	template<bool SlowRandom, bool Accumulate, bool Emissive, bool Environment, bool Jitter, int Bounces>
+	void RenderKernel();
+	template<bool SlowRandom, bool Emissive, bool Environment, bool Jitter, int Bounces>
+	glm::vec4 PerPixelKernel(const Scene& scene, uint32_t x, uint32_t y, uint32_t index, uint32_t sample);
+
+	//	the cached camera ray when there is nothing to jitter, otherwise a jittered one inside the sample's stratum
+	template<bool Jitter>
+	Ray GenerateCameraRay(uint32_t x, uint32_t y, uint32_t index, uint32_t sample, uint32_t& seed) const;
+
+	void RenderGeneric();
+
+	/*	rows go to the NUMA pinned threads if there are any, otherwise to std::execution::par - rowFunc(row, scene)
+		gets the scene the row should read, its own node's copy when the scene is replicated	*/
+	template<typename RowFunc>
+	void ForEachRow(RowFunc&& rowFunc);
+
+	/*	the buffers come as untouched pages, with a thread pool every node writes its own band first,
+		which places the memory of that band on the node	*/
+	void AllocateBuffers(uint32_t width, uint32_t height);
+	void FreeBuffers();
+	void SetThreadPool(std::unique_ptr<RenderThreadPool> pool);
+	void UpdateThreadPool();	//	follows settings.numaAware
+	void UpdateRayDirections();	//	points rayDirections at the camera's, or at the node local copy of them
+	void ReplicateScene(const Scene& scene);	//	brings nodeScenes up to date with the scene
+
+	using KernelFn = void (Renderer::*)();
+	template<size_t... I>
+	static constexpr auto MakeKernelTable(std::index_sequence<I...>);
+	/*	looked up once per frame, emissive is true if any material in the scene gives off light,
+		environment if the scene has an environment map loaded, jitter if the camera rays get jittered	*/
+	static KernelFn SelectKernel(const Settings& settings, bool emissive, bool environment, bool jitter);
+
 private:
 	/*	i may have more than one image at the same time in 
 		the pipeline, so it will be clear that it is the final buffer*/
 	std::shared_ptr<Walnut::Image> finalImage;
 	uint32_t* imageData = nullptr;	// buffer of pixel data
+	size_t bufferPixels = 0;	//	how many pixels the buffers were allocated for
 	
 	/*	buffer of accumulated data, related to path tracing, which will allow to store one,
 		definitive image, instead of rendering new random ray bounces every frame, because it
@@ -68,11 +159,31 @@ private:
 		to average the paths out with it as the number of evaluated paths, so it's a divider	*/
 	uint32_t frameIndex = 1;
 
+	//	picked up from the settings once per Render, the strata form a strataPerAxis x strataPerAxis grid in the pixel
+	uint32_t samplesPerPixel = 1;
+	uint32_t strataPerAxis = 1;
+	uint32_t accumulatedSamples = 0;	//	paths per pixel in accumulationData, this frame's included
+	bool jitterCameraRays = false;	//	off for a single sample per pixel, unless it's accumulated with antiAliasing on
+	//	RenderGeneric splits the frame in row tasks instead of nested per-pixel ones, only while benchmarking
+	bool genericRowTasks = false;
+
 	Settings settings;
 
 	const Scene* activeScene = nullptr;
 	const Camera* activeCamera = nullptr;
 
+	std::unique_ptr<RenderThreadPool> threadPool;
+	bool numaAwareActive = false;	//	what UpdateThreadPool last applied
+	std::vector<Scene> nodeScenes;	//	one per node of the thread pool, only filled with replicateScene on
+	std::shared_ptr<EnvironmentMap> replicatedEnvironment;	//	the map the nodes' copies were made from
+
+	/*	what the kernels read the unjittered camera rays from - with a thread pool a copy placed like the pixels,
+		allocated and copied only when the rays aren't jittered, nothing reads it otherwise	*/
+	const glm::vec3* rayDirections = nullptr;
+	glm::vec3* localRayDirections = nullptr;
+	const Camera* rayDirectionsCamera = nullptr;	//	which camera and version localRayDirections was copied from
+	uint32_t rayDirectionsVersion = 0;
+
 	/*	i'll use these to allow running a parallel multi-threaded std::for_each loop
 		while rendering the image, because now i will have an iterator from a vector	*/
 	std::vector<uint32_t> horizontalIter;
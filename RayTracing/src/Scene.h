@@ -1,8 +1,11 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <memory>
 #include <vector>
 
+#include "EnvironmentMap.h"
+
 struct Material {
 	glm::vec3 albedo{ 1.0f };
 	float roughness = 1.0f; //	not smooth, not reflective
@@ -24,6 +27,7 @@ struct Sphere {
 struct Scene {
 	std::vector<Sphere> objects;
 	std::vector<Material> materials;
+	std::shared_ptr<EnvironmentMap> environment;	//	lights the scene when set, rays that miss everything are black otherwise
 };
 
 /*	physically based rendering - a way to standardize parameters to
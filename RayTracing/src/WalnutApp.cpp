@@ -6,6 +6,7 @@
 #include "Renderer.h"
 #include "Camera.h"
 #include "Scene.h"
+#include "BatchRender.h"
 
 #include <glm/gtc/type_ptr.hpp>
 
@@ -57,6 +58,11 @@ public:
 	}
 
 	virtual void OnUpdate(float ts) override {
+		//	the camera follows the path while a batch is running
+		if (batchRender.IsRunning()) {
+			return;
+		}
+
 		if (myCamera.OnUpdate(ts)) {
 			myRenderer.ResetFrameIndex();
 		}
@@ -73,18 +79,98 @@ public:
 
 		ImGui::Separator();
 
+		//	a running batch owns the renderer and the scene, any change would end up in the frames it writes
+		ImGui::BeginDisabled(batchRender.IsRunning());
+
 		if (ImGui::Button("Render")) {
 			Render();
 		}
 
 		ImGui::Checkbox("Accumulate", &myRenderer.GetSettings().accumulate);
 		ImGui::Checkbox("Slow Random", &myRenderer.GetSettings().slowRandom);
+		ImGui::Checkbox("Specialized Kernels", &myRenderer.GetSettings().specializedKernels);
+		if (ImGui::SliderInt("Bounces", &myRenderer.GetSettings().bounces, 1, Renderer::MaxBounces)) {
+			myRenderer.ResetFrameIndex();
+		}
+		if (ImGui::SliderInt("Samples per pixel", &myRenderer.GetSettings().samplesPerPixel, 1, 64)) {
+			myRenderer.ResetFrameIndex();
+		}
+		if (ImGui::Checkbox("Anti-aliasing", &myRenderer.GetSettings().antiAliasing)) {
+			myRenderer.ResetFrameIndex();
+		}
 
 		if (ImGui::Button("Reset")) {
 			myRenderer.ResetFrameIndex();
 		}
 
+		const Numa::Topology& topology = Numa::GetTopology();
+		ImGui::Text("NUMA nodes: %u, processors: %u", (uint32_t)topology.nodes.size(), topology.GetProcessorCount());
+		ImGui::Checkbox("NUMA Aware", &myRenderer.GetSettings().numaAware);
+		ImGui::Checkbox("Replicate Scene", &myRenderer.GetSettings().replicateScene);
+
+		if (ImGui::Button("Benchmark NUMA")) {
+			numaBenchmarks = myRenderer.BenchmarkNuma(myScene, myCamera);
+		}
+		for (const Renderer::NumaBenchmark& benchmark : numaBenchmarks) {
+			ImGui::Text("%s (%u threads): %.3fms", benchmark.name.c_str(), benchmark.threads, benchmark.frameMs);
+		}
+
+		if (ImGui::Button("Benchmark Kernels")) {
+			kernelBenchmarks = myRenderer.BenchmarkKernels(myScene, myCamera);
+		}
+		for (const Renderer::KernelBenchmark& benchmark : kernelBenchmarks) {
+			ImGui::Text("%s: %.3fms -> %.3fms (%.2fx)", benchmark.name.c_str(), benchmark.genericMs,
+				benchmark.specializedMs, benchmark.genericMs / benchmark.specializedMs);
+		}
+
+		ImGui::Separator();
+
+		ImGui::InputText("Environment map", environmentFile, sizeof(environmentFile));
+		if (ImGui::Button("Load Environment")) {
+			auto environment = std::make_shared<EnvironmentMap>();
+			if (environment->Load(environmentFile)) {
+				myScene.environment = environment;
+				myRenderer.ResetFrameIndex();
+			}
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Clear Environment")) {
+			myScene.environment.reset();
+			myRenderer.ResetFrameIndex();
+		}
+
+		ImGui::EndDisabled();
+
+		ImGui::Separator();
+
+		ImGui::InputText("Camera path", batchPathFile, sizeof(batchPathFile));
+		ImGui::InputText("Output prefix", batchOutputPrefix, sizeof(batchOutputPrefix));
+		ImGui::DragInt("Frames", &batchFrameCount, 1.0f, 1, 10000);
+		ImGui::DragInt("Samples per frame", &batchSamplesPerFrame, 1.0f, 1, 4096);
+		ImGui::DragInt2("Resolution", batchResolution, 1.0f, 1, 8192);
+		if (batchRender.IsRunning()) {
+			ImGui::Text("Rendering frame %u / %u", batchRender.GetCurrentFrame() + 1, batchRender.GetFrameCount());
+			if (ImGui::Button("Cancel Batch")) {
+				batchRender.Cancel(myRenderer, myCamera, myScene);
+			}
+		}
+		else if (ImGui::Button("Render Batch")) {
+			CameraPath path;
+			if (path.LoadFromFile(batchPathFile)) {
+				BatchRender::Settings batchSettings;
+				batchSettings.frameCount = (uint32_t)batchFrameCount;
+				batchSettings.samplesPerFrame = (uint32_t)batchSamplesPerFrame;
+				batchSettings.outputPrefix = batchOutputPrefix;
+				batchSettings.width = (uint32_t)batchResolution[0];
+				batchSettings.height = (uint32_t)batchResolution[1];
+				batchRender.Start(path, batchSettings, myRenderer, myCamera, myScene);
+			}
+		}
+
 		ImGui::Separator();
+
+		//	the spheres would be put back when the batch finishes anyway - asked again, the batch may have just started or ended
+		ImGui::BeginDisabled(batchRender.IsRunning());
 		for (size_t i = 0; i < myScene.objects.size(); i++) {
 			ImGui::PushID(i);
 
@@ -110,6 +196,7 @@ public:
 			ImGui::Separator();
 			ImGui::PopID();
 		}
+		ImGui::EndDisabled();
 
 		ImGui::End();
 
@@ -138,9 +225,15 @@ public:
 	void Render() {
 		Timer timer;
 
-		myRenderer.OnResize(viewportWidth, viewportHeight);
-		myCamera.OnResize(viewportWidth, viewportHeight);
-		myRenderer.Render(myScene, myCamera);
+		//	a running batch renders at its own fixed size and moves the camera along the path
+		if (batchRender.IsRunning()) {
+			batchRender.Step(myRenderer, myCamera, myScene);
+		}
+		else {
+			myRenderer.OnResize(viewportWidth, viewportHeight);
+			myCamera.OnResize(viewportWidth, viewportHeight);
+			myRenderer.Render(myScene, myCamera);
+		}
 
 		lastRenderTime = timer.ElapsedMillis();
 	}
@@ -154,6 +247,17 @@ private:
 	uint32_t viewportHeight = 0;
 
 	float lastRenderTime = 0.0f;
+	std::vector<Renderer::KernelBenchmark> kernelBenchmarks;
+	std::vector<Renderer::NumaBenchmark> numaBenchmarks;
+
+	char environmentFile[256] = "environment.hdr";
+
+	BatchRender batchRender;
+	char batchPathFile[256] = "camera_path.txt";
+	char batchOutputPrefix[256] = "frame_";
+	int batchFrameCount = 60;
+	int batchSamplesPerFrame = 64;
+	int batchResolution[2] = { 1280, 720 };
 };
 
 Walnut::Application* Walnut::CreateApplication(int argc, char** argv)